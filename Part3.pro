@@ -8,8 +8,14 @@ LIBS += -L/usr/lib/x86_64-linux-gnu -lopencv_core -lopencv_imgcodecs -lopencv_hi
 SOURCES += \
         src/areascontainer.cpp \
         src/imageprocesser.cpp \
-        src/main.cpp
+        src/main.cpp \
+        src/resultcache.cpp \
+        src/roimask.cpp \
+        src/streamprocesser.cpp
 
 HEADERS += \
     src/areascontainer.h \
-    src/imageprocesser.h
+    src/imageprocesser.h \
+    src/resultcache.h \
+    src/roimask.h \
+    src/streamprocesser.h
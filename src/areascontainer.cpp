@@ -1,4 +1,94 @@
 #include "areascontainer.h"
+#include <cmath>
+#include <limits>
+#include <unordered_map>
+
+namespace {
+
+///! Расстояние от точки p до отрезка [a; b]
+float pointSegmentDistance(const Point2f &p, const Point2f &a, const Point2f &b)
+{
+    const Point2f ab(b.x - a.x, b.y - a.y);
+    const Point2f ap(p.x - a.x, p.y - a.y);
+    const float length2 = ab.x * ab.x + ab.y * ab.y;
+    float t = length2 > 0 ? (ap.x * ab.x + ap.y * ab.y) / length2 : 0.0f;
+    t = std::clamp(t, 0.0f, 1.0f);
+    const float dx = ap.x - t * ab.x;
+    const float dy = ap.y - t * ab.y;
+    return std::sqrt(dx * dx + dy * dy);
+}
+
+///! Ориентированная площадь треугольника (a, b, c)
+float cross(const Point2f &a, const Point2f &b, const Point2f &c)
+{
+    return (b.x - a.x) * (c.y - a.y) - (b.y - a.y) * (c.x - a.x);
+}
+
+///! Находится ли точка p внутри выпуклого четырехугольника poly
+bool isInside(const Point2f &p, const Point2f (&poly)[4])
+{
+    bool hasPositive {false};
+    bool hasNegative {false};
+    for(int i = 0; i < 4; i++){
+        const float value = cross(poly[i], poly[(i + 1) % 4], p);
+        hasPositive = hasPositive || value > 0;
+        hasNegative = hasNegative || value < 0;
+    }
+    // Вырожденный четырехугольник не содержит точек, расстояние до него
+    // определяется по отрезкам
+    return !(hasPositive && hasNegative) && (hasPositive || hasNegative);
+}
+
+///! Пересекаются ли отрезки [a; b] и [c; d] во внутренних точках
+bool isCrossing(const Point2f &a, const Point2f &b, const Point2f &c, const Point2f &d)
+{
+    const float d1 = cross(c, d, a);
+    const float d2 = cross(c, d, b);
+    const float d3 = cross(a, b, c);
+    const float d4 = cross(a, b, d);
+    return ((d1 > 0 && d2 < 0) || (d1 < 0 && d2 > 0)) && ((d3 > 0 && d4 < 0) || (d3 < 0 && d4 > 0));
+}
+
+///! Расстояние между повернутыми прямоугольниками (0 - если пересекаются)
+float rectsDistance(const RotatedRect &first, const RotatedRect &second)
+{
+    Point2f a[4];
+    Point2f b[4];
+    first.points(a);
+    second.points(b);
+
+    float distance = std::numeric_limits<float>::max();
+    for(int i = 0; i < 4; i++){
+        if(isInside(a[i], b) || isInside(b[i], a)){
+            return 0.0f;
+        }
+        for(int j = 0; j < 4; j++){
+            if(isCrossing(a[i], a[(i + 1) % 4], b[j], b[(j + 1) % 4])){
+                return 0.0f;
+            }
+            distance = std::min(distance, pointSegmentDistance(a[i], b[j], b[(j + 1) % 4]));
+            distance = std::min(distance, pointSegmentDistance(b[i], a[j], a[(j + 1) % 4]));
+        }
+    }
+    return distance;
+}
+
+///! Направление длинной стороны прямоугольника в градусах, [0; 180)
+float axisAngle(const RotatedRect &rect)
+{
+    float angle = rect.size.width >= rect.size.height ? rect.angle : rect.angle + 90.0f;
+    angle = std::fmod(angle, 180.0f);
+    return angle < 0 ? angle + 180.0f : angle;
+}
+
+///! Разность направлений a и b в градусах, [0; 90]
+float angleDifference(float a, float b)
+{
+    const float difference = std::fabs(std::fmod(a - b, 180.0f));
+    return std::min(difference, 180.0f - difference);
+}
+
+}
 
 int Area::mID = 0;
 
@@ -114,6 +204,11 @@ Area::AreaType Area::getAreaType() const
     return mAreaType;
 }
 
+vector<int> Area::getClassificationThresholds()
+{
+    return {SCRATCH_MIN_LENGTH, SCRATCH_MAX_WIDTH, POINT_MAX_MEASURE};
+}
+
 void Area::updateCharacticParams()
 {
     long long xSum {0};
@@ -248,6 +343,160 @@ set<shared_ptr<Area> > AreasContainer::getAreas() const
     return mAreas;
 }
 
+vector<AreaRecord> AreasContainer::getAreaRecords() const
+{
+    vector<AreaRecord> records;
+    for(const auto &area : mAreas){
+        records.push_back({area->getAreaType(), area->getSquare(), area->getBaricenter(),
+                           area->getBoardingRect()});
+    }
+    return records;
+}
+
+void AreasContainer::groupNearAreas(float maxGap, float maxAngle)
+{
+    vector<shared_ptr<Area>> areas;
+    for(const auto &area : mAreas){
+        if(area->getAreaType() != Area::AreaType::Zone){
+            areas.push_back(area);
+        }
+    }
+    if(areas.size() < 2){
+        return;
+    }
+
+    // Габариты областей, расширенные на maxGap, и размер ячейки сетки
+    vector<cv::Rect> boxes;
+    double dimensionSum {0};
+    for(const auto &area : areas){
+        const cv::Rect box = area->getBoardingRect().boundingRect();
+        boxes.push_back({box.x - static_cast<int>(std::ceil(maxGap)), box.y - static_cast<int>(std::ceil(maxGap)),
+                         box.width + 2 * static_cast<int>(std::ceil(maxGap)),
+                         box.height + 2 * static_cast<int>(std::ceil(maxGap))});
+        dimensionSum += std::max(boxes.back().width, boxes.back().height);
+    }
+    const int cellSize = std::max(1, static_cast<int>(dimensionSum / areas.size()));
+    const auto cellKey = [](int cx, int cy){
+        return (static_cast<long long>(cx) << 32) ^ static_cast<unsigned int>(cy);
+    };
+    const auto cellOf = [cellSize](int value){
+        return value >= 0 ? value / cellSize : (value + 1) / cellSize - 1;
+    };
+
+    std::unordered_map<long long, vector<int>> grid;
+    for(size_t i = 0; i < areas.size(); i++){
+        const cv::Rect &box = boxes[i];
+        for(int cy = cellOf(box.y); cy <= cellOf(box.y + box.height); cy++){
+            for(int cx = cellOf(box.x); cx <= cellOf(box.x + box.width); cx++){
+                grid[cellKey(cx, cy)].push_back(i);
+            }
+        }
+    }
+
+    // Система непересекающихся множеств для групп
+    vector<int> parent(areas.size());
+    vector<int> groupSize(areas.size(), 1);
+    for(size_t i = 0; i < areas.size(); i++){
+        parent[i] = i;
+    }
+    const auto findRoot = [&parent](int i){
+        while(parent[i] != i){
+            parent[i] = parent[parent[i]];
+            i = parent[i];
+        }
+        return i;
+    };
+
+    const auto isOriented = [](const RotatedRect &rect){
+        const float minSide = std::min(rect.size.width, rect.size.height);
+        const float maxSide = std::max(rect.size.width, rect.size.height);
+        return maxSide >= GROUP_MIN_ELONGATION * std::max(minSide, 1.0f);
+    };
+
+    vector<int> lastVisitor(areas.size(), -1);
+    for(size_t i = 0; i < areas.size(); i++){
+        const RotatedRect rect = areas[i]->getBoardingRect();
+        const cv::Rect &box = boxes[i];
+        for(int cy = cellOf(box.y); cy <= cellOf(box.y + box.height); cy++){
+            for(int cx = cellOf(box.x); cx <= cellOf(box.x + box.width); cx++){
+                const auto cell = grid.find(cellKey(cx, cy));
+                for(const int j : cell->second){
+                    // Каждая пара проверяется один раз
+                    if(j <= static_cast<int>(i) || lastVisitor[j] == static_cast<int>(i)){
+                        continue;
+                    }
+                    lastVisitor[j] = i;
+
+                    // Хотя бы один фрагмент пары должен задавать направление, иначе
+                    // соседние изотропные точки (шум) сливались бы в ложные дефекты
+                    const RotatedRect other = areas[j]->getBoardingRect();
+                    if(!isOriented(rect) && !isOriented(other)){
+                        continue;
+                    }
+                    if(rectsDistance(rect, other) > maxGap){
+                        continue;
+                    }
+
+                    // Направление между центрами должно совпадать с направлением
+                    // вытянутых фрагментов
+                    const float dx = other.center.x - rect.center.x;
+                    const float dy = other.center.y - rect.center.y;
+                    if(dx != 0 || dy != 0){
+                        float direction = std::atan2(dy, dx) * 180.0f / static_cast<float>(CV_PI);
+                        direction = direction < 0 ? direction + 180.0f : direction;
+                        if((isOriented(rect) && angleDifference(direction, axisAngle(rect)) > maxAngle) ||
+                           (isOriented(other) && angleDifference(direction, axisAngle(other)) > maxAngle)){
+                            continue;
+                        }
+                    }
+
+                    int first = findRoot(i);
+                    int second = findRoot(j);
+                    if(first == second){
+                        continue;
+                    }
+                    if(groupSize[first] < groupSize[second]){
+                        std::swap(first, second);
+                    }
+                    parent[second] = first;
+                    groupSize[first] += groupSize[second];
+                }
+            }
+        }
+    }
+
+    // Слияние групп в наибольшую область и повторная классификация
+    set<int> changedRoots;
+    vector<int> order(areas.size());
+    for(size_t i = 0; i < areas.size(); i++){
+        order[i] = i;
+    }
+    std::sort(order.begin(), order.end(), [&areas](int a, int b){
+        return areas[a]->getSquare() > areas[b]->getSquare();
+    });
+    std::map<int, int> target;
+    for(const int i : order){
+        const int root = findRoot(i);
+        const auto it = target.find(root);
+        if(it == target.end()){
+            target[root] = i;
+            continue;
+        }
+        areas[it->second]->merge(areas[i]);
+        mAreas.erase(areas[i]);
+        changedRoots.insert(it->second);
+    }
+
+    for(const int i : changedRoots){
+        areas[i]->updateCharacticParams();
+    }
+}
+
+float AreasContainer::getGroupMinElongation()
+{
+    return GROUP_MIN_ELONGATION;
+}
+
 void AreasContainer::beginUpdateContainer()
 {
     mStatus = Updatintg;
@@ -260,3 +509,126 @@ void AreasContainer::endUpdateContainer()
     }
     mStatus = Done;
 }
+
+StreamAreasContainer::StreamAreasContainer(AreaHandler handler) :
+    mHandler(std::move(handler))
+{
+
+}
+
+StreamAreasContainer::~StreamAreasContainer()
+{
+
+}
+
+void StreamAreasContainer::addRow(int y, const cv::Mat &row)
+{
+    if(y != mNextRow){
+        // Разрыв в нумерации строк: все открытые области уже не могут продолжиться
+        finish();
+    }
+    mNextRow = y + 1;
+
+    // Разбиение строки на отрезки черных пикселов
+    vector<Run> runs;
+    const uchar *pixels = row.ptr<uchar>(0);
+    for(int x = 0; x < row.cols; x++){
+        if(pixels[x] != 0){
+            continue;
+        }
+        const int x0 = x;
+        while(x + 1 < row.cols && pixels[x + 1] == 0){
+            x++;
+        }
+        runs.push_back({x0, x, -1});
+    }
+
+    // Переназначение меток поглощенных при слиянии областей
+    std::map<int, int> redirect;
+    const auto resolve = [&redirect](int label){
+        auto it = redirect.find(label);
+        while(it != redirect.end()){
+            label = it->second;
+            it = redirect.find(label);
+        }
+        return label;
+    };
+
+    size_t firstPrev = 0;
+    for(auto &run : runs){
+        // Отрезки предыдущей строки упорядочены, поэтому достаточно одного прохода
+        while(firstPrev < mPrevRuns.size() && mPrevRuns[firstPrev].mX1 < run.mX0 - 1){
+            firstPrev++;
+        }
+        for(size_t i = firstPrev; i < mPrevRuns.size() && mPrevRuns[i].mX0 <= run.mX1 + 1; i++){
+            const int label = resolve(mPrevRuns[i].mLabel);
+            if(run.mLabel < 0){
+                run.mLabel = label;
+                continue;
+            }
+            if(label == run.mLabel){
+                continue;
+            }
+
+            // Слияние меньшей области в большую
+            int target = run.mLabel;
+            int source = label;
+            if(mOpenAreas[target]->getSquare() < mOpenAreas[source]->getSquare()){
+                std::swap(target, source);
+            }
+            mOpenAreas[target]->merge(mOpenAreas[source]);
+            mOpenAreas.erase(source);
+            redirect[source] = target;
+            run.mLabel = target;
+        }
+
+        if(run.mLabel < 0){
+            run.mLabel = mNextLabel++;
+            mOpenAreas[run.mLabel] = std::make_shared<Area>();
+        }
+    }
+
+    set<int> touched;
+    for(auto &run : runs){
+        run.mLabel = resolve(run.mLabel);
+        touched.insert(run.mLabel);
+        const shared_ptr<Area> &area = mOpenAreas[run.mLabel];
+        for(int x = run.mX0; x <= run.mX1; x++){
+            area->append({x, y});
+        }
+    }
+
+    // Области без продолжения в текущей строке больше не могут вырасти
+    for(auto it = mOpenAreas.begin(); it != mOpenAreas.end();){
+        if(touched.find(it->first) != touched.end()){
+            ++it;
+            continue;
+        }
+        closeArea(it->second);
+        it = mOpenAreas.erase(it);
+    }
+
+    mPrevRuns = std::move(runs);
+}
+
+void StreamAreasContainer::finish()
+{
+    for(const auto &[label, area] : mOpenAreas){
+        closeArea(area);
+    }
+    mOpenAreas.clear();
+    mPrevRuns.clear();
+}
+
+int StreamAreasContainer::getOpenAreasNumber() const
+{
+    return mOpenAreas.size();
+}
+
+void StreamAreasContainer::closeArea(const shared_ptr<Area> &area)
+{
+    area->updateCharacticParams();
+    if(mHandler){
+        mHandler(area);
+    }
+}
@@ -8,6 +8,8 @@
 #include <iterator>
 #include <vector>
 #include <memory>
+#include <map>
+#include <functional>
 #include <opencv2/opencv.hpp>
 
 using std::pair;
@@ -92,14 +94,33 @@ public:
     pair<int, int> getBaricenter() const;
     ///! Метод получения типа области
     AreaType getAreaType() const;
+    ///! Возвращает пороги классификации областей
+    static vector<int> getClassificationThresholds();
 
 private:
     friend class AreasContainer;
+    friend class StreamAreasContainer;
     void updateCharacticParams();
 };
 
 
+///! Итоговые характеристики области, достаточные для отчета о дефекте
+struct AreaRecord{
+    ///! Тип области
+    Area::AreaType type {Area::AreaType::Undefined};
+    ///! Площадь области
+    int square {0};
+    ///! Барицентр области
+    pair<int, int> baricenter {0, 0};
+    ///! Обрамляющий прямоугольник
+    RotatedRect boardingRect;
+};
+
+
 class AreasContainer{
+    ///! Минимальное отношение сторон, при котором у области есть направление
+    static constexpr float GROUP_MIN_ELONGATION {2.0f};
+
     set<shared_ptr<Area>> mAreas;
 
     ///! Вспомогательный статус для оптимизации времени обновления данных
@@ -130,7 +151,18 @@ public:
     vector<pair<int, int>> getAreasBaricenters() const;
     ///! Возвращает все области
     set<shared_ptr<Area>> getAreas() const;
+    ///! Возвращает итоговые характеристики всех областей
+    vector<AreaRecord> getAreaRecords() const;
     vector<vector<cv::Point>> getBoardingRectsContours() const;
+    ///! Объединяет фрагменты одного дефекта: области (кроме незаполненностей), чьи
+    /// обрамляющие прямоугольники находятся на расстоянии не более maxGap, а
+    /// направление между ними отличается от направления каждой вытянутой области не
+    /// более чем на maxAngle градусов. Хотя бы одна область каждой пары должна быть
+    /// вытянутой: две изотропные точки не объединяются. Группы классифицируются заново.
+    /// Кандидаты ищутся по равномерной сетке, время работы близко к линейному
+    void groupNearAreas(float maxGap, float maxAngle);
+    ///! Возвращает минимальное отношение сторон, при котором у области есть направление
+    static float getGroupMinElongation();
     ///! Вспомогательный метод. Используется для оптимизации обновления
     /// внутренних состояний
     void beginUpdateContainer();
@@ -140,4 +172,50 @@ public:
 
 private :
 };
+
+///! Контейнер для построчной разметки областей. Строки бинарного изображения
+/// подаются последовательно сверху вниз, черные пикселы строки группируются в
+/// отрезки и связываются (8-связность) с отрезками предыдущей строки. Область
+/// завершается и передается обработчику, как только в очередной строке к ней не
+/// примыкает ни один отрезок, поэтому в памяти хранятся только открытые области.
+class StreamAreasContainer{
+public:
+    ///! Обработчик завершенной области
+    using AreaHandler = std::function<void(const shared_ptr<Area>&)>;
+
+private:
+    ///! Отрезок черных пикселов строки [mX0; mX1], принадлежащий области mLabel
+    struct Run{
+        int mX0;
+        int mX1;
+        int mLabel;
+    };
+
+    ///! Обработчик завершенных областей
+    AreaHandler mHandler;
+    ///! Отрезки предыдущей строки
+    vector<Run> mPrevRuns;
+    ///! Открытые области по их меткам
+    std::map<int, shared_ptr<Area>> mOpenAreas;
+    ///! Следующая свободная метка
+    int mNextLabel {0};
+    ///! Номер следующей ожидаемой строки
+    int mNextRow {0};
+
+public:
+    explicit StreamAreasContainer(AreaHandler handler);
+    ~StreamAreasContainer();
+
+    ///! Добавляет очередную строку y бинарного изображения (черный пиксел - 0).
+    /// Строки должны подаваться подряд, начиная с нулевой
+    void addRow(int y, const cv::Mat &row);
+    ///! Завершает все открытые области. Вызывается после последней строки
+    void finish();
+    ///! Возвращает количество открытых областей
+    int getOpenAreasNumber() const;
+
+private:
+    ///! Завершает область и передает ее обработчику
+    void closeArea(const shared_ptr<Area> &area);
+};
 #endif // AREASCONTAINER_H
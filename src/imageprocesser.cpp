@@ -1,13 +1,15 @@
 #include "imageprocesser.h"
 #include "areascontainer.h"
-#include "imageprocesser.h"
+#include "resultcache.h"
+#include "roimask.h"
+#include <cstring>
 
-void ImageProcesser::fillRectByCoord(cv::Mat &image, int y0, int x0, int size){
-    const int yN = y0 + size;
-    const int xN = x0 + size;
+void ImageProcesser::fillRectByCoord(cv::Mat &image, int y0, int x0, int size, const cv::Rect &clipRect){
+    const int yN = std::min(y0 + size, clipRect.y + clipRect.height);
+    const int xN = std::min(x0 + size, clipRect.x + clipRect.width);
 
-    for(int y = y0; y < yN; y++){
-        for(int x = x0; x < xN; x++){
+    for(int y = std::max(y0, clipRect.y); y < yN; y++){
+        for(int x = std::max(x0, clipRect.x); x < xN; x++){
             image.at<uchar>(y, x) = 0;
         }
     }
@@ -21,6 +23,42 @@ ImageProcesser::ImageProcesser()
     mAreaContainer = new AreasContainer;
 }
 
+ImageProcesser::~ImageProcesser()
+{
+    delete mAreaContainer;
+}
+
+void ImageProcesser::setFrameRows(int rowOffset, std::optional<int> frameRows)
+{
+    mFrameRowOffset = rowOffset;
+    mFrameRows = frameRows;
+}
+
+int ImageProcesser::getPreprocessRadius()
+{
+    return PRE_MEDIAN_KSIZE/2 + GAUSS_KSIZE/2 + ADAPTIVE_BLOCK_SIZE/2
+            + CLEAN_MEDIAN_KSIZE_1/2 + CLEAN_MEDIAN_KSIZE_2/2;
+}
+
+int ImageProcesser::getRectSize() const
+{
+    return mRectSize;
+}
+
+int ImageProcesser::getPostShadowRadius(const PipelineParams &params) const
+{
+    // Окно заполнения пустот влияет на все свои строки целиком
+    return mRectSize + params.blurTimes * (params.blurKSize/2);
+}
+
+void ImageProcesser::applyPipeline(const PipelineParams &params)
+{
+    removeShadow(params.shadowBorder);
+    fillEmptinesInAreas();
+    applyMedianBlur(params.blurTimes, params.blurKSize);
+    applyThreshold(params.thresholdLow, params.thresholdHigh);
+}
+
 int ImageProcesser::countBlackPixels(const cv::Mat &image) {
     int count = 0;
     for (int y = 0; y < image.rows; y++) {
@@ -34,16 +72,87 @@ int ImageProcesser::countBlackPixels(const cv::Mat &image) {
 }
 
 void ImageProcesser::applyMedianBlur(int times, int kSize){
-    cv::Mat result = mAllImagesInStages.at(Filled);
-    for(int i = 0; i < times; i++){
-        cv::medianBlur(result,  result, kSize);
-    }
-    mAllImagesInStages[Blured] = result;
+    mAllImagesInStages[Blured] = applyInRoi(Blured, mAllImagesInStages.at(Filled), times * (kSize/2),
+                                            [times, kSize](const cv::Mat &src, cv::Mat &dst){
+        // Стадия Filled не изменяется: первый проход пишет в новый буфер
+        if(times <= 0){
+            src.copyTo(dst);
+            return;
+        }
+        cv::medianBlur(src, dst, kSize);
+        for(int i = 1; i < times; i++){
+            cv::medianBlur(dst,  dst, kSize);
+        }
+    });
 }
 
 void ImageProcesser::applyThreshold(int low, int high)
 {
-    cv::threshold(mAllImagesInStages[Blured], mAllImagesInStages[BinImage], low, high, cv::THRESH_BINARY);
+    mAllImagesInStages[BinImage] = applyInRoi(BinImage, mAllImagesInStages[Blured], 0,
+                                              [low, high](const cv::Mat &src, cv::Mat &dst){
+        cv::threshold(src, dst, low, high, cv::THRESH_BINARY);
+    });
+}
+
+void ImageProcesser::setRoiMask(std::shared_ptr<const RoiMask> roiMask)
+{
+    // Пустая маска равносильна ее отсутствию: обрабатывается весь кадр
+    mRoiMask = roiMask && !roiMask->isEmpty() ? std::move(roiMask) : nullptr;
+    mRoiBuffers.clear();
+}
+
+bool ImageProcesser::hasRoi() const
+{
+    const auto it = mAllImagesInStages.find(Original);
+    return mRoiMask && !mRoiMask->isEmpty() && it != mAllImagesInStages.end() &&
+            mRoiMask->getSize() == it->second.size();
+}
+
+cv::Rect ImageProcesser::getProcessRect() const
+{
+    if(hasRoi()){
+        return mRoiMask->getBoundingRect();
+    }
+    const auto it = mAllImagesInStages.find(Original);
+    if(it == mAllImagesInStages.end()){
+        return cv::Rect();
+    }
+    return cv::Rect(0, 0, it->second.cols, it->second.rows);
+}
+
+cv::Mat ImageProcesser::applyInRoi(ImageStage stage, const cv::Mat &image, int radius,
+                                   const std::function<void(const cv::Mat&, cv::Mat&)> &filter)
+{
+    if(!hasRoi()){
+        cv::Mat result;
+        filter(image, result);
+        return result;
+    }
+
+    // Фильтр применяется к обрамляющему прямоугольнику с перекрытием radius,
+    // вне маски изображение остается белым
+    const cv::Rect roiRect = mRoiMask->getBoundingRect();
+    // Белый фон кадра выделяется один раз для маски и размера кадра, далее
+    // перезаписывается только обрамляющий прямоугольник
+    cv::Mat &result = mRoiBuffers[stage];
+    if(result.size() != image.size() || result.type() != image.type()){
+        result = cv::Mat(image.size(), image.type(), cv::Scalar(255));
+    }
+    if(roiRect.empty()){
+        return result;
+    }
+    const int x0 = std::max(0, roiRect.x - radius);
+    const int y0 = std::max(0, roiRect.y - radius);
+    const int xN = std::min(image.cols, roiRect.x + roiRect.width + radius);
+    const int yN = std::min(image.rows, roiRect.y + roiRect.height + radius);
+    const cv::Rect haloRect(x0, y0, xN - x0, yN - y0);
+
+    cv::Mat filtered;
+    filter(image(haloRect), filtered);
+    cv::Mat resultRoi = result(roiRect);
+    filtered(cv::Rect(roiRect.x - x0, roiRect.y - y0, roiRect.width, roiRect.height)).copyTo(resultRoi);
+    resultRoi.setTo(cv::Scalar(255), mRoiMask->getOutsideMask());
+    return result;
 }
 
 int ImageProcesser::getPercentOfSquare(int size, double part){
@@ -53,10 +162,15 @@ int ImageProcesser::getPercentOfSquare(int size, double part){
 void ImageProcesser::removeShadow(int borderSize)
 {
     cv::Mat result = mAllImagesInStages.at(Gray);
-    for(int y = 0; y < result.rows; y++){
-        for(int x = 0; x < result.cols; x++){
-            if(y < borderSize || x < borderSize || abs(x - result.cols) < borderSize ||
-               abs(y - result.rows) < borderSize){
+    const cv::Rect processRect = getProcessRect();
+    for(int y = processRect.y; y < processRect.y + processRect.height; y++){
+        // Номер строки в полном кадре; нижняя граница учитывается, только если высота
+        // кадра известна
+        const int frameY = y + mFrameRowOffset;
+        const bool isFrameBottom = mFrameRows && abs(frameY - *mFrameRows) < borderSize;
+        for(int x = processRect.x; x < processRect.x + processRect.width; x++){
+            if(frameY < borderSize || x < borderSize || abs(x - result.cols) < borderSize ||
+               isFrameBottom){
                 result.at<uchar>(y, x) = 255;
             }
         }
@@ -64,6 +178,83 @@ void ImageProcesser::removeShadow(int borderSize)
     mAllImagesInStages[RemovedShadow] = result;
 }
 
+void ImageProcesser::setResultCache(ResultCache *cache)
+{
+    mResultCache = cache;
+}
+
+uint64_t ImageProcesser::getResultKey(const PipelineParams &params)
+{
+    if(!mResultKey){
+        mResultKey = ResultCache::hashImage(0, mAllImagesInStages.at(Original));
+    }
+
+    uint64_t key = *mResultKey;
+    for(const int value : {PRE_MEDIAN_KSIZE, GAUSS_KSIZE, ADAPTIVE_BLOCK_SIZE, ADAPTIVE_C,
+                           CLEAN_MEDIAN_KSIZE_1, CLEAN_MEDIAN_KSIZE_2, mRectSize, mFillRate,
+                           params.shadowBorder, params.blurTimes, params.blurKSize,
+                           params.thresholdLow, params.thresholdHigh,
+                           params.tileSize, params.tileMinBlackPixels}){
+        key = ResultCache::combine(key, value);
+    }
+    uint64_t fillingPartBits {0};
+    std::memcpy(&fillingPartBits, &mFillingPart, sizeof(mFillingPart));
+    key = ResultCache::combine(key, fillingPartBits);
+    key = ResultCache::combine(key, hasRoi() ? mRoiMask->getHash() : 0);
+    for(const float value : {params.groupGap, params.groupMaxAngle,
+                             AreasContainer::getGroupMinElongation()}){
+        uint32_t valueBits {0};
+        std::memcpy(&valueBits, &value, sizeof(value));
+        key = ResultCache::combine(key, valueBits);
+    }
+    for(const int threshold : Area::getClassificationThresholds()){
+        key = ResultCache::combine(key, threshold);
+    }
+    return key;
+}
+
+bool ImageProcesser::loadCachedResult(const PipelineParams &params)
+{
+    if(!mResultCache){
+        return false;
+    }
+
+    CachedResult result;
+    if(!mResultCache->find(getResultKey(params), result)){
+        return false;
+    }
+
+    if(!result.finalImage.empty()){
+        mAllImagesInStages[FinalImage] = result.finalImage;
+    }
+    mCachedAreas = result.areas;
+    mIsCachedResult = true;
+    return true;
+}
+
+void ImageProcesser::storeCachedResult(const PipelineParams &params)
+{
+    if(!mResultCache){
+        return;
+    }
+
+    CachedResult result;
+    result.areas = mAreaContainer->getAreaRecords();
+    const auto finalIt = mAllImagesInStages.find(FinalImage);
+    if(finalIt != mAllImagesInStages.end()){
+        result.finalImage = finalIt->second;
+    }
+    mResultCache->store(getResultKey(params), result);
+}
+
+std::vector<AreaRecord> ImageProcesser::getAreaRecords() const
+{
+    if(mIsCachedResult){
+        return mCachedAreas;
+    }
+    return mAreaContainer->getAreaRecords();
+}
+
 void ImageProcesser::showImage(ImageStage stage) const
 {
     if(mAllImagesInStages.find(stage) == mAllImagesInStages.end()){
@@ -110,8 +301,15 @@ cv::Mat ImageProcesser::getImage(ImageStage stage) const
 void ImageProcesser::fillEmptinesInAreas(){
     //cv::Mat imageProc = mAllImagesInStages[Gray];
     cv::Mat imageProc = mAllImagesInStages[RemovedShadow];
-    for(int y = 1; y < imageProc.rows - mRectSize; y += mRectSize){
-        for(int x = 1; x < imageProc.cols - mRectSize; x += mRectSize){
+    // Окна сетки, пересекающие обрамляющий прямоугольник маски
+    const cv::Rect processRect = getProcessRect();
+    const auto gridStart = [this](int value){
+        return value > 1 ? 1 + (value - 1) / mRectSize * mRectSize : 1;
+    };
+    const int yN = std::min(imageProc.rows - mRectSize, processRect.y + processRect.height);
+    const int xN = std::min(imageProc.cols - mRectSize, processRect.x + processRect.width);
+    for(int y = gridStart(processRect.y); y < yN; y += mRectSize){
+        for(int x = gridStart(processRect.x); x < xN; x += mRectSize){
             cv::Rect windowRect(x, y, mRectSize, mRectSize);
             cv::Mat window = imageProc(windowRect);
             int blackPixelCount = countBlackPixels(window);
@@ -120,28 +318,134 @@ void ImageProcesser::fillEmptinesInAreas(){
                 continue;
             }
 
-            fillRectByCoord(imageProc, y, x, mRectSize);
+            // За пределы обрамляющего прямоугольника маски заполнение не выходит
+            fillRectByCoord(imageProc, y, x, mRectSize, processRect);
         }
     }
     mAllImagesInStages[Filled] = imageProc;
 }
 
+int ImageProcesser::findCandidateTiles(int tileSize, int minBlackPixels){
+    const cv::Rect processRect = getProcessRect();
+    if(processRect.empty()){
+        mCandidateTiles = std::vector<cv::Rect>();
+        return 0;
+    }
+    const cv::Mat image = mAllImagesInStages.at(BinImage)(processRect);
+    tileSize = std::max(1, tileSize);
+    minBlackPixels = std::max(1, minBlackPixels);
+
+    // Маска черных пикселов (1 - черный) и ее интегральное изображение
+    cv::Mat blackMask;
+    cv::threshold(image, blackMask, 0, 1, cv::THRESH_BINARY_INV);
+    cv::Mat sums;
+    cv::integral(blackMask, sums, CV_32S);
+
+    std::vector<cv::Rect> tiles;
+    for(int y = 0; y < image.rows; y += tileSize){
+        const int yN = std::min(y + tileSize, image.rows);
+        const int *top = sums.ptr<int>(y);
+        const int *bottom = sums.ptr<int>(yN);
+        for(int x = 0; x < image.cols; x += tileSize){
+            const int xN = std::min(x + tileSize, image.cols);
+            const int blackPixelCount = bottom[xN] - bottom[x] - top[xN] + top[x];
+            if(blackPixelCount >= minBlackPixels){
+                tiles.push_back(cv::Rect(processRect.x + x, processRect.y + y, xN - x, yN - y));
+            }
+        }
+    }
+
+    mCandidateTiles = tiles;
+    return tiles.size();
+}
+
+bool ImageProcesser::isDefectFree() const{
+    if(mIsCachedResult){
+        return mCachedAreas.empty();
+    }
+    return mCandidateTiles && mCandidateTiles->empty();
+}
+
 void ImageProcesser::initAreaContainer(){
     const cv::Mat image = mAllImagesInStages.at(BinImage);
+    const cv::Rect processRect = getProcessRect();
+    const bool hasTiles = mCandidateTiles.has_value();
+    const std::vector<cv::Rect> tiles = hasTiles ? *mCandidateTiles : std::vector<cv::Rect>{processRect};
+    const bool isRoi = hasRoi();
+
+    // Плитки-кандидаты служат затравками: каждая задевающая их область размечается
+    // целиком, в том числе в соседних плитках с малым числом черных пикселов
+    cv::Mat visited;
+    if(hasTiles){
+        visited = cv::Mat::zeros(processRect.size(), CV_8UC1);
+    }
+    vector<pair<int, int>> stack;
+    const auto addComponent = [&](int x0, int y0){
+        visited.at<uchar>(y0 - processRect.y, x0 - processRect.x) = 1;
+        stack.push_back({x0, y0});
+        while(!stack.empty()){
+            const auto [x, y] = stack.back();
+            stack.pop_back();
+            mAreaContainer->addPoint({x, y});
+            const int nyN = std::min(y + 2, processRect.y + processRect.height);
+            const int nxN = std::min(x + 2, processRect.x + processRect.width);
+            for(int ny = std::max(y - 1, processRect.y); ny < nyN; ny++){
+                for(int nx = std::max(x - 1, processRect.x); nx < nxN; nx++){
+                    uchar &isVisited = visited.at<uchar>(ny - processRect.y, nx - processRect.x);
+                    if(!isVisited && image.at<uchar>(ny, nx) == 0){
+                        isVisited = 1;
+                        stack.push_back({nx, ny});
+                    }
+                }
+            }
+        }
+    };
+
     mAreaContainer->beginUpdateContainer();
-    for (int y = 0; y < image.rows; y++){
-        for (int x = 0; x < image.cols; x++){
-            if (image.at<uchar>(y, x) == 0){
-                mAreaContainer->addPoint({x, y});
+    for (const auto &tile : tiles){
+        const int tileXN = tile.x + tile.width;
+        for (int y = tile.y; y < tile.y + tile.height; y++){
+            // Без маски строка плитки - один отрезок
+            const std::vector<std::pair<int, int>> fullRow {{tile.x, tileXN}};
+            for (const auto &span : isRoi ? mRoiMask->getRowSpans(y) : fullRow){
+                const int xN = std::min(span.second, tileXN);
+                for (int x = std::max(span.first, tile.x); x < xN; x++){
+                    if (image.at<uchar>(y, x) != 0){
+                        continue;
+                    }
+                    if (!hasTiles){
+                        mAreaContainer->addPoint({x, y});
+                    }
+                    else if (!visited.at<uchar>(y - processRect.y, x - processRect.x)){
+                        addComponent(x, y);
+                    }
+                }
             }
         }
     }
     mAreaContainer->endUpdateContainer();
 }
 
+void ImageProcesser::groupAreas(float maxGap, float maxAngle){
+    if(maxGap <= 0){
+        return;
+    }
+    mAreaContainer->groupNearAreas(maxGap, maxAngle);
+}
+
 void ImageProcesser::generateFinalImage(){
+    // Для детали без дефектов финальное изображение не формируется
+    if(isDefectFree()){
+        return;
+    }
+
     const set<pair<int, int>> borders = mAreaContainer->getBorderPoints();
     const set<shared_ptr<Area>> areas = mAreaContainer->getAreas();
+    // Цветное изображение нужно только для отрисовки и формируется по требованию
+    if(mAllImagesInStages.find(RGB) == mAllImagesInStages.end()){
+        mAllImagesInStages[RGB] = cv::Mat(mAllImagesInStages.at(Original).size(), CV_8UC3);
+        cv::cvtColor(mAllImagesInStages.at(Original), mAllImagesInStages[RGB], cv::COLOR_GRAY2RGB);
+    }
     cv::Mat imageGRB = mAllImagesInStages[RGB];
     size_t counter{0};
 
@@ -196,34 +500,51 @@ void ImageProcesser::showAndSave(const cv::Mat image, const std::string &title,
     cv::imwrite(filename, image);
 }
 
-int ImageProcesser::readImageFromDir(){
+int ImageProcesser::readImageFromDir(bool needPreprocess){
     const cv::Mat imageOriginal = cv::imread("/home/rai/Documents/VirtualAssist/AffectDetection/pics/clearPic2.jpg",
                                              cv::IMREAD_GRAYSCALE);
 
+    return setImage(imageOriginal, needPreprocess);
+}
+
+int ImageProcesser::setImage(const cv::Mat &imageOriginal, bool needPreprocess){
     if(imageOriginal.empty()){
         return 1;
     }
 
-    mAllImagesInStages[Original] = imageOriginal;
-    cv::medianBlur(mAllImagesInStages[Original], mAllImagesInStages[Gray], 5);
-    cv::Mat blurredMat;
+    mFrameRowOffset = 0;
+    mFrameRows = imageOriginal.rows;
+    mResultKey.reset();
+    mIsCachedResult = false;
+    mCachedAreas.clear();
+    mCandidateTiles.reset();
 
-    cv::GaussianBlur(mAllImagesInStages[Gray], blurredMat, cv::Size(5, 5), 0);
-    mAllImagesInStages[Gray] = blurredMat;
+    mAllImagesInStages.clear();
+    mAllImagesInStages[Original] = imageOriginal;
+    if(needPreprocess){
+        preprocessImage();
+    }
 
+    return 0;
+}
 
-    cv::Mat adaptiveThresholded;
-    cv::adaptiveThreshold(mAllImagesInStages[Gray], adaptiveThresholded, 255, cv::ADAPTIVE_THRESH_MEAN_C, cv::THRESH_BINARY, 51, 2);
+void ImageProcesser::preprocessImage(){
+    const cv::Mat imageOriginal = mAllImagesInStages.at(Original);
+    mAllImagesInStages[Gray] = applyInRoi(Gray, imageOriginal, getPreprocessRadius(),
+                                          [](const cv::Mat &src, cv::Mat &dst){
+        cv::Mat gray;
+        cv::medianBlur(src, gray, PRE_MEDIAN_KSIZE);
+        cv::Mat blurredMat;
 
-    mAllImagesInStages[Gray] = adaptiveThresholded;
+        cv::GaussianBlur(gray, blurredMat, cv::Size(GAUSS_KSIZE, GAUSS_KSIZE), 0);
 
-    cv::Mat medianBlurred1, medianBlurred2;
-    cv::medianBlur(mAllImagesInStages[Gray], medianBlurred1, 15);
-    cv::medianBlur(medianBlurred1, medianBlurred2, 9);
-    mAllImagesInStages[Gray] = medianBlurred2;
 
-    mAllImagesInStages[RGB] = cv::Mat(imageOriginal.size(), CV_8UC3);
-    cv::cvtColor(mAllImagesInStages[Original], mAllImagesInStages[RGB], cv::COLOR_GRAY2RGB);
+        cv::Mat adaptiveThresholded;
+        cv::adaptiveThreshold(blurredMat, adaptiveThresholded, 255, cv::ADAPTIVE_THRESH_MEAN_C,
+                              cv::THRESH_BINARY, ADAPTIVE_BLOCK_SIZE, ADAPTIVE_C);
 
-    return 0;
+        cv::Mat medianBlurred1;
+        cv::medianBlur(adaptiveThresholded, medianBlurred1, CLEAN_MEDIAN_KSIZE_1);
+        cv::medianBlur(medianBlurred1, dst, CLEAN_MEDIAN_KSIZE_2);
+    });
 }
@@ -4,8 +4,15 @@
 #include <iostream>
 #include <optional>
 #include <map>
+#include <vector>
+#include <memory>
+#include <functional>
+#include <cstdint>
 
 class AreasContainer;
+class ResultCache;
+class RoiMask;
+struct AreaRecord;
 
 ///< Перечисление возможных стадий обработки изображения
 enum ImageStage : uint8_t{
@@ -19,8 +26,44 @@ enum ImageStage : uint8_t{
     FinalImage
 };
 
+///< Параметры стадий обработки, следующих за считыванием изображения
+struct PipelineParams{
+    ///< Ширина затеняемой рамки (removeShadow)
+    int shadowBorder {15};
+    ///< Количество проходов медианного размытия (applyMedianBlur)
+    int blurTimes {1};
+    ///< Размер ядра медианного размытия (applyMedianBlur)
+    int blurKSize {15};
+    ///< Нижний порог бинаризации (applyThreshold)
+    int thresholdLow {128};
+    ///< Верхний порог бинаризации (applyThreshold)
+    int thresholdHigh {255};
+    ///< Максимальный зазор между фрагментами одного дефекта (groupAreas),
+    /// 0 - без группировки (по умолчанию). В потоковом режиме не используется
+    float groupGap {0.0f};
+    ///< Максимальное отклонение направления фрагментов в градусах (groupAreas)
+    float groupMaxAngle {15.0f};
+    ///< Размер плитки для поиска кандидатов в дефекты (findCandidateTiles)
+    int tileSize {64};
+    ///< Минимальное количество черных пикселов в плитке-кандидате (findCandidateTiles).
+    /// Области, не задевающие ни одной плитки-кандидата, считаются шумом
+    int tileMinBlackPixels {1};
+};
+
 class ImageProcesser
 {
+    ///< Размер ядра первичного медианного размытия
+    static const int PRE_MEDIAN_KSIZE {5};
+    ///< Размер ядра размытия по Гауссу
+    static const int GAUSS_KSIZE {5};
+    ///< Размер окна адаптивной бинаризации
+    static const int ADAPTIVE_BLOCK_SIZE {51};
+    ///< Константа адаптивной бинаризации
+    static const int ADAPTIVE_C {2};
+    ///< Размеры ядер медианного размытия после адаптивной бинаризации
+    static const int CLEAN_MEDIAN_KSIZE_1 {15};
+    static const int CLEAN_MEDIAN_KSIZE_2 {9};
+
     ///< Ожидаемый размер заполняемой части
     int mRectSize;
     ///< Ожидаемая заполняемая часть
@@ -28,14 +71,58 @@ class ImageProcesser
     ///< Ожидаемый коэффициент заполнения области
     int mFillRate;
 
+    ///< Смещение первой строки изображения внутри полного кадра
+    int mFrameRowOffset {0};
+    ///< Высота полного кадра, std::nullopt - если еще неизвестна
+    std::optional<int> mFrameRows;
+
     std::map<ImageStage, cv::Mat> mAllImagesInStages;
 
     AreasContainer *mAreaContainer {nullptr};
+    ///< Кэш результатов обработки (не принадлежит объекту)
+    ResultCache *mResultCache {nullptr};
+    ///< Ключ кэша для текущего изображения, вычисляется при первом обращении
+    std::optional<uint64_t> mResultKey;
+    ///< Получен ли результат обработки из кэша
+    bool mIsCachedResult {false};
+    ///< Итоговые характеристики областей, полученные из кэша
+    std::vector<AreaRecord> mCachedAreas;
+    ///< Плитки бинарного изображения, содержащие кандидатов в дефекты.
+    /// std::nullopt - поиск кандидатов не выполнялся
+    std::optional<std::vector<cv::Rect>> mCandidateTiles;
+    ///< Маска области интереса (контура детали), nullptr - обрабатывается весь кадр
+    std::shared_ptr<const RoiMask> mRoiMask;
+    ///< Буферы стадий с белым фоном при работе с маской. Переиспользуются для
+    /// следующих изображений того же размера, пока маска не сменится
+    std::map<ImageStage, cv::Mat> mRoiBuffers;
 public:
     /// Конструктор объекта
     ImageProcesser();
+    ~ImageProcesser();
+    ImageProcesser(const ImageProcesser&) = delete;
+    ImageProcesser& operator=(const ImageProcesser&) = delete;
     ///< Метод считывает изображение из директории по умолчанию
-    int readImageFromDir();
+    int readImageFromDir(bool needPreprocess = true);
+    ///< Метод принимает исходное полутоновое изображение и, если needPreprocess,
+    /// выполняет его первичную обработку
+    int setImage(const cv::Mat &imageOriginal, bool needPreprocess = true);
+    ///< Первичная обработка исходного изображения: стадия Gray. Стадия RGB
+    /// формируется в generateFinalImage
+    void preprocessImage();
+    ///< Задает положение изображения внутри полного кадра: номер первой строки rowOffset
+    /// и высоту кадра frameRows (std::nullopt - высота еще неизвестна). Используется при
+    /// обработке кадра полосами, чтобы removeShadow затенял только границы кадра.
+    /// Вызывается после setImage
+    void setFrameRows(int rowOffset, std::optional<int> frameRows);
+    ///< Возвращает радиус (в строках) окрестности, от которой зависит результат
+    /// первичной обработки в setImage
+    static int getPreprocessRadius();
+    ///< Возвращает размер окна заполнения пустот
+    int getRectSize() const;
+    ///< Возвращает радиус окрестности стадий после removeShadow для параметров params
+    int getPostShadowRadius(const PipelineParams &params) const;
+    ///< Последовательно применяет все стадии обработки вплоть до BinImage
+    void applyPipeline(const PipelineParams &params);
     ///< Возвращает количество черных пикселов в указанном изображении image
     int countBlackPixels(const cv::Mat& image);
     ///< Применяет размытие в квадрате размером kSize, times раз
@@ -48,25 +135,69 @@ public:
     void showImage(ImageStage stage) const;
     ///< Метод заполняет пустоты внутри областей дефектов
     void fillEmptinesInAreas();
-    ///< Метод осуществляет инициализацию обсчитывающего контенера точками из входного изображения
+    ///< Метод находит плитки размером tileSize бинарного изображения, содержащие не менее
+    /// minBlackPixels черных пикселов. Подсчет выполняется по интегральному изображению.
+    /// Возвращает количество найденных плиток
+    int findCandidateTiles(int tileSize, int minBlackPixels);
+    ///< Возвращает true, если дефекты заведомо отсутствуют: нет плиток-кандидатов или
+    /// в кэше сохранен результат без областей
+    bool isDefectFree() const;
+    ///< Метод осуществляет инициализацию обсчитывающего контенера точками из входного изображения.
+    /// Если выполнялся поиск кандидатов, размечаются только области, задевающие
+    /// плитки-кандидаты, но каждая такая область - целиком
     void initAreaContainer();
+    ///< Метод объединяет фрагменты одного дефекта, находящиеся на расстоянии не более
+    /// maxGap вдоль общего направления (с отклонением до maxAngle градусов)
+    void groupAreas(float maxGap, float maxAngle);
     ///< Метод осуществляет генерацию финального изображения.
     /// На оригинальное изображение добавляются:
     /// 1. Границы областей дефектов
     /// 2. Обрамляющие их прямоугольники
     /// 3. Подписи дефектов
+    /// Если дефекты заведомо отсутствуют (isDefectFree), изображение не формируется
     void generateFinalImage();
     ///< Возвращает целочисленное значение количества пикселей в квадрате размером size*part
     /// part - в диапозоне [0:1]
     int getPercentOfSquare(int size, double part);
     void removeShadow(int borderSize);
+    ///< Задает маску области интереса рецепта. Фильтры стадий обрабатывают только
+    /// обрамляющий прямоугольник маски (с перекрытием по радиусу ядра), разметка
+    /// областей - только отрезки маски в строках. Пикселы вне маски считаются фоном
+    /// (белыми). Маска применяется, если ее размер совпадает с размером изображения и
+    /// она не пуста, иначе обрабатывается весь кадр.
+    /// Изображения стадий Gray, Blured и BinImage при этом хранятся в буферах,
+    /// которые переиспользуются для следующего изображения
+    void setRoiMask(std::shared_ptr<const RoiMask> roiMask);
+    ///< Задает кэш результатов обработки. nullptr - кэш не используется
+    void setResultCache(ResultCache *cache);
+    ///< Возвращает ключ кэша: хэш исходного изображения, параметров params, параметров
+    /// первичной обработки, порогов классификации и группировки областей
+    uint64_t getResultKey(const PipelineParams &params);
+    ///< Ищет результат обработки текущего изображения в кэше. При попадании
+    /// финальное изображение (если сохранено) и области берутся из кэша, а все
+    /// стадии после считывания можно пропустить
+    bool loadCachedResult(const PipelineParams &params);
+    ///< Сохраняет в кэш области и финальное изображение
+    void storeCachedResult(const PipelineParams &params);
+    ///< Возвращает итоговые характеристики найденных областей
+    std::vector<AreaRecord> getAreaRecords() const;
 private:
     ///< Метод осуществляет заполнение области в указанных координатах (x0, y0) квадратом
-    /// размера size в изображении image
-    void fillRectByCoord(cv::Mat& image, int y0, int x0, int size);
+    /// размера size в изображении image, не выходя за пределы clipRect
+    void fillRectByCoord(cv::Mat& image, int y0, int x0, int size, const cv::Rect &clipRect);
     ///< Метод показывает указанное изображение в окне с заголовком titile и сохраняет его
     /// по полному имени filename
     void showAndSave(const cv::Mat image, const std::string &title, const std::string &filename) const;
+    ///< Применима ли маска области интереса к текущему изображению
+    bool hasRoi() const;
+    ///< Возвращает обрабатываемую часть изображения: обрамляющий прямоугольник маски
+    /// или все изображение
+    cv::Rect getProcessRect() const;
+    ///< Применяет фильтр filter с радиусом окрестности radius к части изображения image
+    /// внутри маски и записывает результат в буфер стадии stage. Результат вне
+    /// маски - белый
+    cv::Mat applyInRoi(ImageStage stage, const cv::Mat &image, int radius,
+                       const std::function<void(const cv::Mat&, cv::Mat&)> &filter);
 };
 
 #endif // IMAGEPROCESSER_H
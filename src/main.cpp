@@ -1,19 +1,99 @@
 #include <iostream>
+#include <string>
+#include <cstring>
+#include <charconv>
 #include "imageprocesser.h"
+#include "streamprocesser.h"
+#include "resultcache.h"
+#include "roimask.h"
 
-int main()
+///< Потоковая обработка raw-файла полосами строк. Завершенные области выводятся
+/// в стандартный вывод по мере их появления
+int processStream(const std::string &filename, int width, int bandHeight)
 {
+    size_t counter {0};
+    BandStreamProcesser streamProcesser(bandHeight, PipelineParams(),
+                                        [&counter](const shared_ptr<Area> &area){
+        const auto center = area->getBaricenter();
+        std::cout << "Fig." << ++counter << " (" << center.first << ", " << center.second
+                  << ") square " << area->getSquare()
+                  << " type " << static_cast<int>(area->getAreaType()) << std::endl;
+    });
+
+    const int streamRes = streamProcesser.processRawFile(filename, width);
+    if(streamRes == 2){
+        std::cout << "Размер файла не кратен ширине строки " << width << "!" << std::endl;
+        return 1;
+    }
+    if(streamRes){
+        std::cout << "Ошибка чтения файла!" << std::endl;
+        return 1;
+    }
+    return 0;
+}
+
+///< Разбирает положительное целое число из строки text. Возвращает false при ошибке
+bool parsePositive(const char *text, int &value)
+{
+    const char *end = text + std::strlen(text);
+    const auto [ptr, error] = std::from_chars(text, end, value);
+    return error == std::errc() && ptr == end && value > 0;
+}
+
+///< Выводит формат запуска программы
+void printUsage(const char *programName)
+{
+    std::cout << "Использование:" << std::endl
+              << "  " << programName << std::endl
+              << "  " << programName << " <raw-файл> <ширина> [высота полосы]" << std::endl;
+}
+
+int main(int argc, char *argv[])
+{
+    // Потоковый режим: <raw-файл> <ширина> [высота полосы]
+    if(argc > 1){
+        int width {0};
+        int bandHeight {256};
+        if(argc > 4 || argc < 3 || !parsePositive(argv[2], width) ||
+           (argc == 4 && !parsePositive(argv[3], bandHeight))){
+            printUsage(argv[0]);
+            return 1;
+        }
+        return processStream(argv[1], width, bandHeight);
+    }
+
+    const PipelineParams params;
+    // Кэш результатов: до 256 МБ в памяти и до 1 ГБ на диске
+    ResultCache resultCache("./cache", 256 << 20, 1 << 30);
+
     ImageProcesser imageProcesser;
-    const auto readRes = imageProcesser.readImageFromDir();
+    imageProcesser.setResultCache(&resultCache);
+    const auto readRes = imageProcesser.readImageFromDir(false);
     if(readRes){
         return 1;
         std::cout << "Ошибка чтения файла!";
     }
 
     imageProcesser.showImage(ImageStage::Original);
+
+    //Маска области интереса рецепта: обрабатывается только деталь (если маска задана)
+    imageProcesser.setRoiMask(RoiMask::load("./roi.png", imageProcesser.getImage(ImageStage::Original).size()));
+
+    //При попадании в кэш все стадии после считывания пропускаются
+    if(imageProcesser.loadCachedResult(params)){
+        resultCache.printStatistics();
+        if(imageProcesser.isDefectFree()){
+            std::cout << "Дефекты не обнаружены" << std::endl;
+            return 0;
+        }
+        imageProcesser.showImage(ImageStage::FinalImage);
+        return 0;
+    }
+
+    imageProcesser.preprocessImage();
     imageProcesser.showImage(ImageStage::Gray);
 
-    imageProcesser.removeShadow(15);
+    imageProcesser.removeShadow(params.shadowBorder);
     imageProcesser.showImage(ImageStage::RemovedShadow);
 
     //Заполнение пустот внутри областей
@@ -23,24 +103,37 @@ int main()
 
     //Применение размытия
     //imageProcesser.applyMedianBlur(1, 5);
-    imageProcesser.applyMedianBlur(1, 15);
+    imageProcesser.applyMedianBlur(params.blurTimes, params.blurKSize);
     //Вывод изображения
     imageProcesser.showImage(ImageStage::Blured);
 
     //Применение бинаризации
-    imageProcesser.applyThreshold(128, 255);
+    imageProcesser.applyThreshold(params.thresholdLow, params.thresholdHigh);
     //Вывод изображение
     imageProcesser.showImage(ImageStage::BinImage);
 
+    //Быстрая отбраковка чистых деталей: разметка и отрисовка не выполняются
+    imageProcesser.findCandidateTiles(params.tileSize, params.tileMinBlackPixels);
+    if(imageProcesser.isDefectFree()){
+        std::cout << "Дефекты не обнаружены" << std::endl;
+        imageProcesser.storeCachedResult(params);
+        return 0;
+    }
+
     //Заполнение контейнеров для обсчета и идентификации областей дефектов и их
     //типов
     imageProcesser.initAreaContainer();
+    //Объединение фрагментов одного дефекта (выполняется, если задан params.groupGap)
+    imageProcesser.groupAreas(params.groupGap, params.groupMaxAngle);
 
     //Генерация финального изображение
     imageProcesser.generateFinalImage();
     //Вывод финального изображения
     imageProcesser.showImage(ImageStage::FinalImage);
 
+    //Сохранение результата в кэш
+    imageProcesser.storeCachedResult(params);
+    resultCache.printStatistics();
 
     return 0;
 }
@@ -0,0 +1,297 @@
+#include "resultcache.h"
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+#include <limits>
+#include <cstring>
+
+namespace fs = std::filesystem;
+
+ResultCache::ResultCache(const std::string &directory, size_t memoryLimit, uintmax_t diskLimit,
+                         bool storeFinalImage) :
+    mDirectory(directory),
+    mMemoryLimit(memoryLimit),
+    mDiskLimit(diskLimit),
+    mStoreFinalImage(storeFinalImage)
+{
+    if(!mDirectory.empty()){
+        std::error_code error;
+        fs::create_directories(mDirectory, error);
+    }
+}
+
+uint64_t ResultCache::combine(uint64_t hash, uint64_t value)
+{
+    // Перемешивание по схеме splitmix64
+    hash ^= value + 0x9e3779b97f4a7c15ULL + (hash << 6) + (hash >> 2);
+    hash ^= hash >> 30;
+    hash *= 0xbf58476d1ce4e5b9ULL;
+    hash ^= hash >> 27;
+    hash *= 0x94d049bb133111ebULL;
+    hash ^= hash >> 31;
+    return hash;
+}
+
+uint64_t ResultCache::hashImage(uint64_t hash, const cv::Mat &image)
+{
+    hash = combine(hash, image.rows);
+    hash = combine(hash, image.cols);
+    hash = combine(hash, image.type());
+
+    const size_t rowBytes = image.cols * image.elemSize();
+    for(int y = 0; y < image.rows; y++){
+        const uchar *row = image.ptr<uchar>(y);
+        size_t i = 0;
+        // Основной цикл обрабатывает строку словами по 8 байт
+        for(; i + sizeof(uint64_t) <= rowBytes; i += sizeof(uint64_t)){
+            uint64_t word;
+            std::memcpy(&word, row + i, sizeof(word));
+            hash ^= word * 0x87c37b91114253d5ULL;
+            hash = (hash << 27) | (hash >> 37);
+            hash = hash * 0x4cf5ad432745937fULL + y;
+        }
+        uint64_t tail {0};
+        std::memcpy(&tail, row + i, rowBytes - i);
+        hash = combine(hash, tail);
+    }
+    return hash;
+}
+
+bool ResultCache::find(uint64_t key, CachedResult &result)
+{
+    const auto it = mIndex.find(key);
+    if(it != mIndex.end()){
+        mEntries.splice(mEntries.begin(), mEntries, it->second);
+        result = it->second->mResult;
+        // Вызывающий может рисовать на изображении, запись кэша не должна меняться
+        result.finalImage = it->second->mResult.finalImage.clone();
+        mMemoryHits++;
+        return true;
+    }
+
+    if(readFromDisk(key, result)){
+        insertToMemory(key, result);
+        mDiskHits++;
+        return true;
+    }
+
+    mMisses++;
+    return false;
+}
+
+void ResultCache::store(uint64_t key, const CachedResult &result)
+{
+    CachedResult stored = result;
+    if(!mStoreFinalImage){
+        stored.finalImage.release();
+    }
+    insertToMemory(key, stored);
+    writeToDisk(key, stored);
+}
+
+void ResultCache::clearMemory()
+{
+    mEntries.clear();
+    mIndex.clear();
+    mMemoryUsed = 0;
+}
+
+size_t ResultCache::getMemoryHits() const
+{
+    return mMemoryHits;
+}
+
+size_t ResultCache::getDiskHits() const
+{
+    return mDiskHits;
+}
+
+size_t ResultCache::getMisses() const
+{
+    return mMisses;
+}
+
+void ResultCache::printStatistics() const
+{
+    cout << "Cache: memory hits " << mMemoryHits << ", disk hits " << mDiskHits
+         << ", misses " << mMisses << ", entries " << mEntries.size()
+         << " (" << mMemoryUsed << " bytes)" << endl;
+}
+
+void ResultCache::insertToMemory(uint64_t key, const CachedResult &result)
+{
+    const auto it = mIndex.find(key);
+    if(it != mIndex.end()){
+        mMemoryUsed -= it->second->mBytes;
+        mEntries.erase(it->second);
+        mIndex.erase(it);
+    }
+
+    const size_t bytes = estimateBytes(result);
+    if(bytes > mMemoryLimit){
+        return;
+    }
+
+    while(mMemoryUsed + bytes > mMemoryLimit && !mEntries.empty()){
+        mMemoryUsed -= mEntries.back().mBytes;
+        mIndex.erase(mEntries.back().mKey);
+        mEntries.pop_back();
+    }
+
+    // Запись хранит собственную копию пикселов, а не разделяет буфер с источником
+    CachedResult stored = result;
+    stored.finalImage = result.finalImage.clone();
+    mEntries.push_front({key, stored, bytes});
+    mIndex[key] = mEntries.begin();
+    mMemoryUsed += bytes;
+}
+
+bool ResultCache::readFromDisk(uint64_t key, CachedResult &result) const
+{
+    if(mDirectory.empty()){
+        return false;
+    }
+
+    const std::string path = getEntryPath(key);
+    std::ifstream file(path + ".txt");
+    if(!file){
+        return false;
+    }
+
+    std::string magic;
+    int version {0};
+    uint64_t storedKey {0};
+    size_t count {0};
+    bool hasImage {false};
+    file >> magic >> version >> std::hex >> storedKey >> std::dec >> count >> hasImage;
+    if(!file || magic != "AFFECT_CACHE" || version != FORMAT_VERSION || storedKey != key){
+        return false;
+    }
+
+    CachedResult loaded;
+    for(size_t i = 0; i < count; i++){
+        AreaRecord record;
+        int type {0};
+        file >> type >> record.square >> record.baricenter.first >> record.baricenter.second
+             >> record.boardingRect.center.x >> record.boardingRect.center.y
+             >> record.boardingRect.size.width >> record.boardingRect.size.height
+             >> record.boardingRect.angle;
+        if(!file){
+            return false;
+        }
+        record.type = static_cast<Area::AreaType>(type);
+        loaded.areas.push_back(record);
+    }
+
+    if(hasImage){
+        loaded.finalImage = cv::imread(path + ".png", cv::IMREAD_UNCHANGED);
+        if(loaded.finalImage.empty()){
+            return false;
+        }
+    }
+
+    // Обновление времени записи используется как признак недавнего использования
+    std::error_code error;
+    fs::last_write_time(path + ".txt", fs::file_time_type::clock::now(), error);
+
+    result = loaded;
+    return true;
+}
+
+void ResultCache::writeToDisk(uint64_t key, const CachedResult &result) const
+{
+    if(mDirectory.empty()){
+        return;
+    }
+
+    const std::string path = getEntryPath(key);
+    const bool hasImage = !result.finalImage.empty();
+    if(hasImage && !cv::imwrite(path + ".png", result.finalImage)){
+        return;
+    }
+
+    // Файл записей пишется последним и атомарно, он подтверждает целостность записи
+    {
+        std::ofstream file(path + ".tmp");
+        if(!file){
+            return;
+        }
+        file << "AFFECT_CACHE " << FORMAT_VERSION << " " << std::hex << key << std::dec << " "
+             << result.areas.size() << " " << hasImage << "\n";
+        file << std::setprecision(std::numeric_limits<float>::max_digits10);
+        for(const auto &record : result.areas){
+            file << static_cast<int>(record.type) << " " << record.square << " "
+                 << record.baricenter.first << " " << record.baricenter.second << " "
+                 << record.boardingRect.center.x << " " << record.boardingRect.center.y << " "
+                 << record.boardingRect.size.width << " " << record.boardingRect.size.height << " "
+                 << record.boardingRect.angle << "\n";
+        }
+    }
+    std::error_code error;
+    fs::rename(path + ".tmp", path + ".txt", error);
+
+    evictFromDisk();
+}
+
+void ResultCache::evictFromDisk() const
+{
+    struct DiskEntry{
+        fs::path mStem;
+        fs::file_time_type mTime;
+        uintmax_t mBytes {0};
+    };
+
+    std::error_code error;
+    std::map<std::string, DiskEntry> entries;
+    uintmax_t totalBytes {0};
+    for(const auto &file : fs::directory_iterator(mDirectory, error)){
+        const fs::path path = file.path();
+        const uintmax_t bytes = fs::file_size(path, error);
+        if(error){
+            continue;
+        }
+        DiskEntry &entry = entries[path.stem().string()];
+        entry.mStem = fs::path(path).replace_extension();
+        entry.mBytes += bytes;
+        if(path.extension() == ".txt"){
+            entry.mTime = fs::last_write_time(path, error);
+        }
+        totalBytes += bytes;
+    }
+
+    if(totalBytes <= mDiskLimit){
+        return;
+    }
+
+    vector<DiskEntry> ordered;
+    for(const auto &[stem, entry] : entries){
+        ordered.push_back(entry);
+    }
+    std::sort(ordered.begin(), ordered.end(), [](const DiskEntry &a, const DiskEntry &b){
+        return a.mTime < b.mTime;
+    });
+
+    for(const auto &entry : ordered){
+        if(totalBytes <= mDiskLimit){
+            break;
+        }
+        for(const char *extension : {".txt", ".png", ".tmp"}){
+            fs::remove(fs::path(entry.mStem).replace_extension(extension), error);
+        }
+        totalBytes -= entry.mBytes;
+    }
+}
+
+std::string ResultCache::getEntryPath(uint64_t key) const
+{
+    std::ostringstream name;
+    name << std::hex << std::setw(16) << std::setfill('0') << key;
+    return (fs::path(mDirectory) / name.str()).string();
+}
+
+size_t ResultCache::estimateBytes(const CachedResult &result)
+{
+    return sizeof(Entry) + result.areas.size() * sizeof(AreaRecord)
+            + result.finalImage.total() * result.finalImage.elemSize();
+}
@@ -0,0 +1,91 @@
+#ifndef RESULTCACHE_H
+#define RESULTCACHE_H
+#include <opencv2/opencv.hpp>
+#include <cstdint>
+#include <string>
+#include <list>
+#include <unordered_map>
+#include "areascontainer.h"
+
+///< Результат обработки изображения, сохраняемый в кэше
+struct CachedResult{
+    ///< Итоговые характеристики найденных областей
+    vector<AreaRecord> areas;
+    ///< Финальное изображение (может отсутствовать)
+    cv::Mat finalImage;
+};
+
+///< Кэш результатов обработки, индексируемый хэшем входного изображения и всех
+/// параметров обработки. Хранит записи в памяти (LRU) и в каталоге на диске,
+/// объем обоих хранилищ ограничен.
+class ResultCache
+{
+    ///< Версия формата записей на диске
+    static const int FORMAT_VERSION {1};
+
+    ///< Элемент кэша в памяти
+    struct Entry{
+        uint64_t mKey;
+        CachedResult mResult;
+        size_t mBytes;
+    };
+
+    ///< Каталог для хранения записей, пустая строка - только память
+    std::string mDirectory;
+    ///< Ограничение объема записей в памяти, байт
+    size_t mMemoryLimit;
+    ///< Ограничение объема записей на диске, байт
+    uintmax_t mDiskLimit;
+    ///< Сохранять ли финальное изображение
+    bool mStoreFinalImage;
+
+    ///< Записи в порядке последнего использования (первая - самая свежая)
+    std::list<Entry> mEntries;
+    std::unordered_map<uint64_t, std::list<Entry>::iterator> mIndex;
+    ///< Текущий объем записей в памяти, байт
+    size_t mMemoryUsed {0};
+
+    size_t mMemoryHits {0};
+    size_t mDiskHits {0};
+    size_t mMisses {0};
+public:
+    /// Конструктор объекта
+    ResultCache(const std::string &directory, size_t memoryLimit, uintmax_t diskLimit,
+                bool storeFinalImage = true);
+
+    ///< Добавляет к хэшу hash целое значение value
+    static uint64_t combine(uint64_t hash, uint64_t value);
+    ///< Добавляет к хэшу hash размеры, тип и все пикселы изображения image
+    static uint64_t hashImage(uint64_t hash, const cv::Mat &image);
+
+    ///< Ищет результат по ключу key. Возвращает true при попадании
+    bool find(uint64_t key, CachedResult &result);
+    ///< Сохраняет результат по ключу key
+    void store(uint64_t key, const CachedResult &result);
+    ///< Очищает записи в памяти
+    void clearMemory();
+
+    ///< Возвращает количество попаданий в памяти
+    size_t getMemoryHits() const;
+    ///< Возвращает количество попаданий на диске
+    size_t getDiskHits() const;
+    ///< Возвращает количество промахов
+    size_t getMisses() const;
+    ///< Выводит статистику кэша в стандартный вывод
+    void printStatistics() const;
+private:
+    ///< Помещает запись в память, вытесняя давно не использованные
+    void insertToMemory(uint64_t key, const CachedResult &result);
+    ///< Считывает запись с диска. Возвращает true при успехе
+    bool readFromDisk(uint64_t key, CachedResult &result) const;
+    ///< Записывает запись на диск и вытесняет старые записи при превышении объема
+    void writeToDisk(uint64_t key, const CachedResult &result) const;
+    ///< Удаляет с диска самые старые записи, пока объем превышает ограничение
+    void evictFromDisk() const;
+    ///< Возвращает путь к файлу записи без расширения
+    std::string getEntryPath(uint64_t key) const;
+    ///< Оценивает объем записи в памяти
+    static size_t estimateBytes(const CachedResult &result);
+};
+
+#endif // RESULTCACHE_H
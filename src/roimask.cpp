@@ -0,0 +1,143 @@
+#include "roimask.h"
+#include "resultcache.h"
+#include <fstream>
+#include <filesystem>
+
+std::map<std::string, std::shared_ptr<const RoiMask>> RoiMask::mLoadedMasks;
+
+RoiMask::RoiMask(const cv::Mat &mask)
+{
+    cv::threshold(mask, mMask, 0, 255, cv::THRESH_BINARY);
+
+    // Отрезки маски по строкам и обрамляющий прямоугольник
+    std::vector<std::vector<std::pair<int, int>>> rowSpans(mMask.rows);
+    int xMin {mMask.cols};
+    int xMax {-1};
+    int yMin {mMask.rows};
+    int yMax {-1};
+    for(int y = 0; y < mMask.rows; y++){
+        const uchar *row = mMask.ptr<uchar>(y);
+        for(int x = 0; x < mMask.cols; x++){
+            if(row[x] == 0){
+                continue;
+            }
+            const int x0 = x;
+            while(x < mMask.cols && row[x] != 0){
+                x++;
+            }
+            rowSpans[y].push_back({x0, x});
+            xMin = std::min(xMin, x0);
+            xMax = std::max(xMax, x);
+        }
+        if(!rowSpans[y].empty()){
+            yMin = std::min(yMin, y);
+            yMax = y;
+        }
+    }
+
+    if(yMax >= 0){
+        mBoundingRect = cv::Rect(xMin, yMin, xMax - xMin, yMax - yMin + 1);
+        mRowSpans.assign(rowSpans.begin() + yMin, rowSpans.begin() + yMax + 1);
+        cv::bitwise_not(mMask(mBoundingRect), mOutsideMask);
+    }
+
+    mHash = ResultCache::hashImage(0, mMask);
+}
+
+std::shared_ptr<const RoiMask> RoiMask::fromPolygon(const std::vector<cv::Point> &polygon,
+                                                    cv::Size frameSize)
+{
+    if(polygon.size() < 3){
+        return nullptr;
+    }
+    cv::Mat mask = cv::Mat::zeros(frameSize, CV_8UC1);
+    cv::fillPoly(mask, std::vector<std::vector<cv::Point>>{polygon}, cv::Scalar(255));
+    const auto roiMask = std::make_shared<const RoiMask>(mask);
+    return roiMask->isEmpty() ? nullptr : roiMask;
+}
+
+std::shared_ptr<const RoiMask> RoiMask::load(const std::string &filename, cv::Size frameSize)
+{
+    const std::string key = filename + ":" + std::to_string(frameSize.width) + "x"
+            + std::to_string(frameSize.height);
+    const auto it = mLoadedMasks.find(key);
+    if(it != mLoadedMasks.end()){
+        return it->second;
+    }
+
+    // Маска рецепта необязательна: отсутствующий файл не считывается
+    std::error_code error;
+    if(!std::filesystem::exists(filename, error)){
+        return nullptr;
+    }
+
+    std::shared_ptr<const RoiMask> roiMask;
+    if(std::filesystem::path(filename).extension() == ".txt"){
+        std::ifstream file(filename);
+        if(!file){
+            return nullptr;
+        }
+        std::vector<cv::Point> polygon;
+        int x {0};
+        int y {0};
+        while(file >> x >> y){
+            polygon.push_back({x, y});
+        }
+        roiMask = fromPolygon(polygon, frameSize);
+    }
+    else{
+        const cv::Mat mask = cv::imread(filename, cv::IMREAD_GRAYSCALE);
+        if(mask.empty() || mask.size() != frameSize){
+            return nullptr;
+        }
+        roiMask = std::make_shared<const RoiMask>(mask);
+    }
+
+    // Пустая маска скрыла бы все дефекты, поэтому считается некорректной и не кэшируется
+    if(!roiMask || roiMask->isEmpty()){
+        return nullptr;
+    }
+
+    mLoadedMasks[key] = roiMask;
+    return roiMask;
+}
+
+cv::Mat RoiMask::getMask() const
+{
+    return mMask;
+}
+
+cv::Mat RoiMask::getOutsideMask() const
+{
+    return mOutsideMask;
+}
+
+cv::Rect RoiMask::getBoundingRect() const
+{
+    return mBoundingRect;
+}
+
+const std::vector<std::pair<int, int>> &RoiMask::getRowSpans(int y) const
+{
+    static const std::vector<std::pair<int, int>> emptySpans;
+    const int index = y - mBoundingRect.y;
+    if(index < 0 || index >= static_cast<int>(mRowSpans.size())){
+        return emptySpans;
+    }
+    return mRowSpans[index];
+}
+
+bool RoiMask::isEmpty() const
+{
+    return mBoundingRect.empty();
+}
+
+cv::Size RoiMask::getSize() const
+{
+    return mMask.size();
+}
+
+uint64_t RoiMask::getHash() const
+{
+    return mHash;
+}
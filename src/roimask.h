@@ -0,0 +1,58 @@
+#ifndef ROIMASK_H
+#define ROIMASK_H
+#include <opencv2/opencv.hpp>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+///< Маска области интереса (контура детали). Хранит бинарную маску кадра,
+/// ее обрамляющий прямоугольник и отрезки маски в каждой строке, чтобы стадии
+/// обработки работали только с пикселами детали.
+class RoiMask
+{
+    ///< Маска кадра (255 - деталь, 0 - фон)
+    cv::Mat mMask;
+    ///< Инвертированная маска внутри обрамляющего прямоугольника (255 - фон)
+    cv::Mat mOutsideMask;
+    ///< Обрамляющий прямоугольник маски
+    cv::Rect mBoundingRect;
+    ///< Отрезки [x0; x1) маски для строк обрамляющего прямоугольника
+    std::vector<std::vector<std::pair<int, int>>> mRowSpans;
+    ///< Хэш маски для ключа кэша результатов
+    uint64_t mHash {0};
+
+    ///< Загруженные маски по именам файлов
+    static std::map<std::string, std::shared_ptr<const RoiMask>> mLoadedMasks;
+public:
+    /// Конструктор объекта по бинарной маске (ненулевые пикселы - деталь)
+    explicit RoiMask(const cv::Mat &mask);
+
+    ///< Создает маску кадра размером frameSize по многоугольнику polygon. Возвращает
+    /// nullptr, если вершин меньше трех или многоугольник не задевает кадр
+    static std::shared_ptr<const RoiMask> fromPolygon(const std::vector<cv::Point> &polygon,
+                                                      cv::Size frameSize);
+    ///< Загружает маску рецепта из файла filename: изображения-маски или текстового
+    /// файла (.txt) с вершинами многоугольника "x y" в каждой строке. Каждый файл
+    /// загружается один раз. Возвращает nullptr, если файла нет или он некорректен
+    /// (многоугольник менее чем из трех вершин, маска без единого пиксела детали)
+    static std::shared_ptr<const RoiMask> load(const std::string &filename, cv::Size frameSize);
+
+    ///< Возвращает маску кадра
+    cv::Mat getMask() const;
+    ///< Возвращает инвертированную маску внутри обрамляющего прямоугольника
+    cv::Mat getOutsideMask() const;
+    ///< Возвращает обрамляющий прямоугольник маски
+    cv::Rect getBoundingRect() const;
+    ///< Возвращает отрезки маски в строке y кадра
+    const std::vector<std::pair<int, int>> &getRowSpans(int y) const;
+    ///< Возвращает true, если маска не содержит ни одного пиксела детали
+    bool isEmpty() const;
+    ///< Возвращает размер кадра маски
+    cv::Size getSize() const;
+    ///< Возвращает хэш маски
+    uint64_t getHash() const;
+};
+
+#endif // ROIMASK_H
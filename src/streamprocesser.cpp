@@ -0,0 +1,111 @@
+#include "streamprocesser.h"
+#include <fstream>
+#include <filesystem>
+
+BandStreamProcesser::BandStreamProcesser(int bandHeight, const PipelineParams &params,
+                                         StreamAreasContainer::AreaHandler handler) :
+    mBandHeight(std::max(1, bandHeight)),
+    mParams(params),
+    mAreaContainer(std::move(handler))
+{
+    const ImageProcesser imageProcesser;
+    const int postShadowRadius = imageProcesser.getPostShadowRadius(mParams);
+    mRectSize = imageProcesser.getRectSize();
+    mOverlap = ImageProcesser::getPreprocessRadius() + postShadowRadius;
+    // Нижняя рамка removeShadow известна только в конце кадра, поэтому строки,
+    // на которые она влияет, обрабатываются в finish()
+    mLookahead = std::max(mOverlap, mParams.shadowBorder + postShadowRadius);
+}
+
+int BandStreamProcesser::pushRows(const cv::Mat &rows)
+{
+    if(rows.empty() || rows.type() != CV_8UC1 || (!mBuffer.empty() && rows.cols != mBuffer.cols)){
+        return 1;
+    }
+
+    if(mBuffer.empty()){
+        mBuffer = rows.clone();
+    }
+    else{
+        cv::Mat joined;
+        cv::vconcat(mBuffer, rows, joined);
+        mBuffer = joined;
+    }
+    mReceived += rows.rows;
+
+    while(mReceived - mEmitted >= mBandHeight + mLookahead){
+        processBand(mEmitted, mEmitted + mBandHeight, false);
+    }
+    return 0;
+}
+
+void BandStreamProcesser::finish()
+{
+    while(mEmitted < mReceived){
+        processBand(mEmitted, std::min(mEmitted + mBandHeight, mReceived), true);
+    }
+    mAreaContainer.finish();
+    mBuffer.release();
+}
+
+int BandStreamProcesser::processRawFile(const std::string &filename, int width)
+{
+    std::ifstream file(filename, std::ios::binary);
+    if(!file || width <= 0){
+        return 1;
+    }
+
+    // Файл без заголовка: его размер должен быть кратен ширине строки
+    std::error_code error;
+    const uintmax_t fileSize = std::filesystem::file_size(filename, error);
+    if(error || fileSize == 0 || fileSize % static_cast<uintmax_t>(width) != 0){
+        return 2;
+    }
+
+    cv::Mat band(mBandHeight, width, CV_8UC1);
+    while(file){
+        file.read(reinterpret_cast<char*>(band.data), static_cast<std::streamsize>(band.total()));
+        const int rowsRead = file.gcount() / width;
+        if(rowsRead == 0){
+            break;
+        }
+        if(pushRows(band.rowRange(0, rowsRead))){
+            return 1;
+        }
+    }
+
+    finish();
+    return 0;
+}
+
+int BandStreamProcesser::getOverlap() const
+{
+    return mOverlap;
+}
+
+void BandStreamProcesser::processBand(int y0, int yN, bool isFrameEnd)
+{
+    // Начало перекрытия выравнивается по сетке окон fillEmptinesInAreas
+    int slabStart = std::max(0, y0 - mOverlap);
+    slabStart -= slabStart % mRectSize;
+    const int slabEnd = std::min(mReceived, yN + mOverlap);
+
+    ImageProcesser imageProcesser;
+    imageProcesser.setImage(mBuffer.rowRange(slabStart - mBufferStart, slabEnd - mBufferStart).clone());
+    imageProcesser.setFrameRows(slabStart, isFrameEnd ? std::optional<int>(mReceived) : std::nullopt);
+    imageProcesser.applyPipeline(mParams);
+
+    const cv::Mat binImage = imageProcesser.getImage(BinImage);
+    for(int y = y0; y < yN; y++){
+        mAreaContainer.addRow(y, binImage.row(y - slabStart));
+    }
+    mEmitted = yN;
+
+    // Строки выше перекрытия следующей полосы больше не понадобятся
+    int keepFrom = std::max(0, mEmitted - mOverlap);
+    keepFrom -= keepFrom % mRectSize;
+    if(keepFrom > mBufferStart){
+        mBuffer = mBuffer.rowRange(keepFrom - mBufferStart, mBuffer.rows).clone();
+        mBufferStart = keepFrom;
+    }
+}
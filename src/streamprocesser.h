@@ -0,0 +1,55 @@
+#ifndef STREAMPROCESSER_H
+#define STREAMPROCESSER_H
+#include <opencv2/opencv.hpp>
+#include <string>
+#include "imageprocesser.h"
+#include "areascontainer.h"
+
+///< Обработчик изображений большой высоты (например, с линейной камеры).
+/// Изображение поступает полосами строк, каждая полоса обрабатывается теми же
+/// стадиями, что и в ImageProcesser, с перекрытием по радиусу всех ядер, а
+/// разметка областей ведется построчно в StreamAreasContainer. В памяти
+/// одновременно находятся только полоса с перекрытием и открытые области.
+class BandStreamProcesser
+{
+    ///< Высота обрабатываемой полосы
+    int mBandHeight;
+    ///< Параметры стадий обработки
+    PipelineParams mParams;
+    ///< Шаг сетки окон fillEmptinesInAreas, по которому выравнивается перекрытие
+    int mRectSize {1};
+    ///< Перекрытие полосы со стороны каждого соседа
+    int mOverlap {0};
+    ///< Количество строк, которые необходимо получить после полосы до ее обработки
+    int mLookahead {0};
+
+    ///< Полученные, но еще не отброшенные строки, начиная с mBufferStart
+    cv::Mat mBuffer;
+    int mBufferStart {0};
+    ///< Количество полученных строк
+    int mReceived {0};
+    ///< Количество строк, переданных в разметку
+    int mEmitted {0};
+
+    StreamAreasContainer mAreaContainer;
+public:
+    /// Конструктор объекта. handler вызывается для каждой завершенной области
+    BandStreamProcesser(int bandHeight, const PipelineParams &params,
+                        StreamAreasContainer::AreaHandler handler);
+    ///< Добавляет очередные строки изображения (CV_8UC1, ширина постоянна)
+    int pushRows(const cv::Mat &rows);
+    ///< Обрабатывает оставшиеся строки и завершает все открытые области
+    void finish();
+    ///< Обрабатывает файл filename без заголовка из 8-битных строк ширины width.
+    /// Возвращает 0 при успехе, 1 - при ошибке чтения, 2 - если размер файла не
+    /// кратен ширине строки
+    int processRawFile(const std::string &filename, int width);
+    ///< Возвращает перекрытие полос
+    int getOverlap() const;
+private:
+    ///< Обрабатывает строки [y0; yN) и передает их в разметку. isFrameEnd - получены
+    /// все строки кадра
+    void processBand(int y0, int yN, bool isFrameEnd);
+};
+
+#endif // STREAMPROCESSER_H